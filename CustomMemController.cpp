@@ -1,19 +1,10 @@
 #include "CustomMemController.h"
+#include <algorithm>
 
-// inputTimeStep: timestep of the most recently read input trace
-static timeType inputTimeStep;
-// outputTimeStep: timestep of the most recently written output trace
-static timeType outputTimeStep;
+using namespace std;
 
-// Statistics
-static int numSwaps;
-static int numMoveToFast;
-static int numMoveToSlow;
-
-// memoryAccesses: array of all the input trace file memory accesses
-vector<memoryAccess *> memoryAccesses;
-// remapTable: array to store the remap entries
-array<remapEntry, NUM_CACHELINES_RLDRAM> remapTable;
+#define WRITE true
+#define READ !WRITE
 
 remapEntry::remapEntry() 
 {
@@ -21,6 +12,8 @@ remapEntry::remapEntry()
         isInFastMem[i] = false;
 
     counter = 0;
+    isDirty = false;
+    isReferenced = false;
 }
 
 // updateCounter(): update the shared counter for this entry
@@ -42,7 +35,7 @@ void remapEntry::resetCounter()
 // resetFlags(): reset the flags for this entry
 void remapEntry::resetFlags() 
 {
-    for (auto i: isInFastMem) 
+    for (auto &i: isInFastMem) 
         i = false;
 }
 
@@ -69,6 +62,130 @@ bool remapEntry::isEntryEmpty()
     return true;
 }
 
+remapCache::remapCache(int cacheSize, int associativity, int entriesPerBlock) :
+associativity(associativity),
+entriesPerBlock(entriesPerBlock),
+numSets(cacheSize > 0 && associativity > 0 && entriesPerBlock > 0 ?
+    cacheSize / (entriesPerBlock * REMAP_ENTRY_SIZE * associativity) : 0),
+sets(numSets * associativity, block{false, false, 0, 0}),
+useCount(0)
+{
+    if (numSets == 0)
+        throw invalid_argument("Remap cache geometry leaves no set: size " + to_string(cacheSize) + ", associativity "
+            + to_string(associativity) + ", entries per block " + to_string(entriesPerBlock));
+
+    numHits = 0;
+    numMisses = 0;
+    numWritebacks = 0;
+}
+
+// access(): look up a block and allocate it on a miss; return true on a hit
+bool remapCache::access(addrType blockNum, long long * evictedBlock)
+{
+    *evictedBlock = -1;
+    useCount++;
+
+    block * b = findBlock(blockNum);
+    if (b) {
+        b->lastUse = useCount;
+        numHits++;
+        return true;
+    }
+
+    // Replace an invalid block if there is one, else the least recently used one
+    block * set = &sets[(blockNum % numSets) * associativity];
+    block * victim = set;
+    for (int way = 0; way < associativity; way++) {
+        if (!set[way].valid) {
+            victim = &set[way];
+            break;
+        }
+        if (set[way].lastUse < victim->lastUse)
+            victim = &set[way];
+    }
+
+    if (victim->valid && victim->dirty) {
+        *evictedBlock = victim->blockNum;
+        numWritebacks++;
+    }
+    *victim = block{true, false, blockNum, useCount};
+    numMisses++;
+    return false;
+}
+
+// isResident(): return true if the block is in the cache; does not count as an access
+bool remapCache::isResident(addrType blockNum)
+{
+    return findBlock(blockNum) != nullptr;
+}
+
+// markDirty(): mark a (resident) block as modified
+void remapCache::markDirty(addrType blockNum)
+{
+    block * b = findBlock(blockNum);
+    if (b) b->dirty = true;
+}
+
+// blockSize(): number of bytes of metadata in one block
+int remapCache::blockSize()
+{
+    return entriesPerBlock * REMAP_ENTRY_SIZE;
+}
+
+// findBlock(): return the resident block holding blockNum or nullptr
+remapCache::block * remapCache::findBlock(addrType blockNum)
+{
+    block * set = &sets[(blockNum % numSets) * associativity];
+    for (int way = 0; way < associativity; way++)
+        if (set[way].valid && set[way].blockNum == blockNum)
+            return &set[way];
+    return nullptr;
+}
+
+streamTable::streamTable() :
+useCount(0)
+{
+    for (auto &st : streams)
+        st = stream{false, 0, 0, 0, 0};
+}
+
+// update(): train the table with a cache line address; return the stride of its stream if the stream is confident and was advanced
+int streamTable::update(addrType cacheLineAddr)
+{
+    useCount++;
+
+    stream * lru = &streams[0];
+    for (auto &st : streams) {
+        if (!st.valid) {
+            if (lru->valid) lru = &st;
+            continue;
+        }
+        if (lru->valid && st.lastUse < lru->lastUse)
+            lru = &st;
+
+        long long delta = (long long)cacheLineAddr - st.frontier;
+        if (delta < -STREAM_MAX_STRIDE || delta > STREAM_MAX_STRIDE)
+            continue;
+
+        st.lastUse = useCount;
+        // Repeated line or a reordered access behind the frontier; the stream neither advances nor breaks
+        if (delta == 0 || (long long)st.stride * delta < 0)
+            return 0;
+
+        st.frontier = cacheLineAddr;
+        if (delta == st.stride) {
+            st.confidence = min(STREAM_CONFIDENCE_MAX, st.confidence + 1);
+        } else {
+            st.stride = delta;
+            st.confidence = max(0, st.confidence - 1);
+        }
+        return st.confidence >= STREAM_CONFIDENCE_THRESHOLD ? st.stride : 0;
+    }
+
+    *lru = stream{true, cacheLineAddr, 0, 0, useCount};
+    return 0;
+}
+
 memoryAccess::memoryAccess(addrType address, bool isWrite, timeType timeStamp) :
 address(address),
 isWrite(isWrite),
@@ -84,29 +201,258 @@ ostream&  operator<<(ostream& os, memoryAccess const& ma) {
     << "\t" << ma.isWrite << "\t" << ma.timeStamp;
 }
 
-// printRemapTableEntry(): print the entire re-map table; use only for debugging
-void printRemapTableEntry(int remapIndex) {
-    remapEntry re = remapTable[remapIndex];
-    printf("RemapEntry: %d, Counter=%d, entryIndices=", remapIndex, re.counter);
-    for (int i = 0; i < NUM_CACHELINES_PER_SEGMENT; i++)
-        printf("%d", re.isInFastMem[i]);
-    printf("\n");
+// translateAddress(): return cache line address in fast memory based on the remap index
+addrType translateAddress(int remapIndex) 
+{
+    addrType newAddress;
+    newAddress = remapIndex << NUM_CACHELINE_BITS;
+    return newAddress;
 }
 
-int countNumFastMemCacheLines() {
-    int count = 0;
-    for (int i = 0; i < remapTable.size(); i++) {
-        for (auto j : remapTable[i].isInFastMem) {
-            if (j) {
-                count++;
-                break;
+customMemController::customMemController(const controllerConfig& config, requestCallback RLCallback, requestCallback LPCallback) :
+config(config),
+RLCallback(RLCallback),
+LPCallback(LPCallback),
+outputTimeStep(0),
+remapTable(NUM_CACHELINES_RLDRAM),
+remapTableCache(config.remapCacheSize, config.remapCacheAssociativity, config.remapCacheEntriesPerBlock),
+proactiveDegree(PROACTIVE_DEGREE_MAX),
+windowProactiveMigrations(0),
+windowUsefulProactiveMigrations(0),
+numSuppressedBatches(0),
+numProducers(0)
+{
+    if (config.migrationUnit != CACHELINE_SIZE && config.migrationUnit != 256 && config.migrationUnit != 1024
+        && config.migrationUnit != MIGRATION_REGION_SIZE) {
+        throw invalid_argument("Unsupported migration unit: " + to_string(config.migrationUnit));
+    }
+
+    numRemapTableBlocks = (NUM_CACHELINES_RLDRAM + config.remapCacheEntriesPerBlock - 1)
+        / config.remapCacheEntriesPerBlock;
+    regionsPerBlock = 0;
+    metadataBaseAddress = config.remapTableInFastMem ? REMAP_TABLE_RL_BASE_ADDR : REMAP_TABLE_LP_BASE_ADDR;
+
+    // The region table holds every LPDRAM region and is reserved right below the remap table
+    if (config.useRemapCache && isRegionMode()) {
+        regionsPerBlock = remapTableCache.blockSize() / regionEntrySize();
+        if (regionsPerBlock == 0)
+            throw invalid_argument("Remap cache blocks of " + to_string(remapTableCache.blockSize())
+                + " bytes cannot hold a region entry of " + to_string(regionEntrySize()) + " bytes");
+
+        unsigned long long numRegions = (LPDRAM_SIZE / CACHELINE_SIZE) / linesPerRegion();
+        unsigned long long regionTableSize = (numRegions + regionsPerBlock - 1) / regionsPerBlock
+            * remapTableCache.blockSize();
+        metadataBaseAddress = (metadataBaseAddress - regionTableSize) & ~(CACHELINE_SIZE - 1);
+    }
+}
+
+customMemController::~customMemController()
+{
+    if (controllerThread.joinable()) {
+        isAborting.store(true, memory_order_relaxed);
+        controllerThread.join();
+    }
+}
+
+// access(): process one access; accesses must be passed in time stamp order
+void customMemController::access(addrType address, bool isWrite, timeType timeStamp)
+{
+    if (isReservedAddress(address))
+        throw out_of_range("Access to the reserved remap table range of LPDRAM");
+
+    memoryAccess ma(address, isWrite, timeStamp);
+    memoryAccess * currMemAccess = &ma;
+    stats.numAccesses++;
+    lookedUpBlocks.clear();
+
+    // Update output time step to be used in output request time stamps
+    outputTimeStep = max(outputTimeStep, currMemAccess->timeStamp);
+
+    remapEntry * currentEntry = &remapTable[currMemAccess->remapIndex];
+
+    if (config.useRemapCache)
+        lookupRemapEntry(currMemAccess->remapIndex);
+
+    int8_t previousCounter = currentEntry->counter;
+    bool previousIsDirty = currentEntry->isDirty;
+    bool previousIsReferenced = currentEntry->isReferenced;
+    bool isPromotion;
+    if (isRegionMode()) {
+        isPromotion = updateRegion(currMemAccess, currentEntry->isInFastMem[currMemAccess->entryIndex]);
+    } else {
+        currentEntry->updateCounter(currMemAccess->entryIndex);
+        isPromotion = currentEntry->isCounterAboveThreshold();
+    }
+    if (!hasFastMemSlot(currMemAccess->remapIndex))
+        isPromotion = false;
+
+    // printRemapTableEntry(currMemAccess->remapIndex);
+    if(isPromotion)
+    {
+        // cout << "---------- Migration Performed ----------" << endl;
+        if (isRegionMode()) {
+            migrateUnit(currMemAccess);
+        } else {
+            promoteCachelines({currMemAccess});
+            stats.numMigrationsPerUnit[0]++;
+            stats.numMigratedLines++;
+        }
+        // printf("Address: 0x%x, RemapIndex: %d, EntryIndex: %d\n",
+        //         currMemAccess->address, currMemAccess->remapIndex, currMemAccess->entryIndex);
+        stats.numMigrations++;
+
+        // The line was just accessed
+        if (config.useProactiveMigration)
+            currentEntry->isReferenced = true;
+
+        if (config.useRemapCache)
+            remapTableCache.markDirty(remapBlockNum(currMemAccess->remapIndex));
+    }
+    else
+    {
+        if (currentEntry->isInFastMem[currMemAccess->entryIndex]) {
+            // Send to RLDRAM with RemapIndex as the address
+            issueRLRequest(translateAddress(currMemAccess->remapIndex), currMemAccess->isWrite);
+            stats.numFastMemHits++;
+            if (config.useProactiveMigration)
+                currentEntry->isReferenced = true;
+
+            if (proactiveLines.erase(currMemAccess->cacheLineAddr)) {
+                stats.numUsefulProactiveMigrations++;
+                windowUsefulProactiveMigrations++;
+            }
+
+            // In cache mode a write hit leaves slow memory stale unless it is written through
+            if (config.memMode == INCLUSIVE_CACHE && currMemAccess->isWrite) {
+                if (config.writePolicy == WRITE_THROUGH)
+                    issueLPRequest(currMemAccess->address, WRITE);
+                else
+                    currentEntry->isDirty = true;
             }
+        } else {
+            // Send to LPDRAM with original address
+            issueLPRequest(currMemAccess->address, currMemAccess->isWrite);
         }
+        outputTimeStep++;
+
+        // The counter, dirty and referenced bits are all part of the remap entry
+        if (config.useRemapCache && (currentEntry->counter != previousCounter || currentEntry->isDirty != previousIsDirty
+            || currentEntry->isReferenced != previousIsReferenced))
+            remapTableCache.markDirty(remapBlockNum(currMemAccess->remapIndex));
     }
-    return count;
+
+    if (config.useProactiveMigration) {
+        int stride = streamDetector.update(currMemAccess->cacheLineAddr);
+        if (stride != 0)
+            migrateAhead(currMemAccess, stride);
+    }
+}
+
+// registerProducer(): allocate a submission ring for one producer thread before start()
+int customMemController::registerProducer()
+{
+    if (controllerThread.joinable())
+        throw logic_error("Producers must be registered before the controller thread starts");
+    if (numProducers == MAX_PRODUCERS)
+        return -1;
+    producers[numProducers] = make_unique<producerRing>();
+    return numProducers++;
+}
+
+// submit(): producer side; queue one access on the producer's ring; return false if the ring is full
+bool customMemController::submit(int producerId, addrType address, bool isWrite, timeType timeStamp)
+{
+    if (isReservedAddress(address))
+        throw out_of_range("Access to the reserved remap table range of LPDRAM");
+    return getProducer(producerId).ring.push(accessRequest{address, isWrite, timeStamp});
+}
+
+// closeProducer(): producer side; signal that this producer will not submit any more accesses
+void customMemController::closeProducer(int producerId)
+{
+    getProducer(producerId).closed.store(true, memory_order_release);
+}
+
+// advanceTime(): producer side; promise that this producer will not submit any access older than timeStamp
+void customMemController::advanceTime(int producerId, timeType timeStamp)
+{
+    getProducer(producerId).watermark.store(timeStamp, memory_order_release);
+}
+
+// getProducer(): ring of a registered producer; throws out_of_range for any other id
+customMemController::producerRing& customMemController::getProducer(int producerId)
+{
+    if (producerId < 0 || producerId >= numProducers)
+        throw out_of_range("Unregistered producer id: " + to_string(producerId));
+    return *producers[producerId];
+}
+
+// start(): launch the controller thread, which drains all rings in time stamp order
+void customMemController::start()
+{
+    if (controllerThread.joinable())
+        throw logic_error("Controller thread already running");
+    controllerThread = thread(&customMemController::drainRings, this);
+}
+
+// stop(): wait until every producer is closed and its ring is drained, then join the controller thread
+void customMemController::stop()
+{
+    if (controllerThread.joinable())
+        controllerThread.join();
 }
 
-int countNumFastMemCacheLines() {
+// drainRings(): controller thread; repeatedly process the oldest access at the head of all rings. An open producer with
+// an empty ring may still submit an access as old as its watermark, so only accesses older than the watermarks of all
+// such producers are processed. Ties go to the producer registered first
+void customMemController::drainRings()
+{
+    while (!isAborting.load(memory_order_relaxed)) {
+        producerRing * oldest = nullptr;
+        bool isWaiting = false;
+        timeType safeTime = numeric_limits<timeType>::max();
+
+        for (int i = 0; i < numProducers; i++) {
+            // Read the closed flag and watermark before the ring so an access pushed before closing or advancing the
+            // watermark is never missed
+            bool closed = producers[i]->closed.load(memory_order_acquire);
+            timeType watermark = producers[i]->watermark.load(memory_order_acquire);
+            accessRequest * req = producers[i]->ring.front();
+
+            if (!req) {
+                if (!closed) {
+                    isWaiting = true;
+                    safeTime = min(safeTime, watermark);
+                }
+                continue;
+            }
+            if (!oldest || req->timeStamp < oldest->ring.front()->timeStamp)
+                oldest = producers[i].get();
+        }
+
+        if (!oldest && !isWaiting)
+            return;
+        if (!oldest || (isWaiting && oldest->ring.front()->timeStamp >= safeTime)) {
+            this_thread::yield();
+            continue;
+        }
+
+        accessRequest req = *oldest->ring.front();
+        oldest->ring.pop();
+        access(req.address, req.isWrite, req.timeStamp);
+    }
+}
+
+// getStats(): statistics so far; only valid while the controller thread is not running
+controllerStats customMemController::getStats()
+{
+    controllerStats s = stats;
+    s.numRemapCacheWritebacks = remapTableCache.numWritebacks;
+    return s;
+}
+
+// countNumFastMemCacheLines(): number of remap entries with a cache line in fast memory
+int customMemController::countNumFastMemCacheLines() {
     int count = 0;
     for (int i = 0; i < remapTable.size(); i++) {
         for (auto j : remapTable[i].isInFastMem) {
@@ -119,213 +465,471 @@ int countNumFastMemCacheLines() {
     return count;
 }
 
-// translateAddress(): return cache line address in fast memory based on the remap index
-addrType translateAddress(int remapIndex) 
+// printRemapTableEntry(): print one entry of the remap table; use only for debugging
+void customMemController::printRemapTableEntry(int remapIndex) {
+    remapEntry re = remapTable[remapIndex];
+    printf("RemapEntry: %d, Counter=%d, entryIndices=", remapIndex, re.counter);
+    for (int i = 0; i < NUM_CACHELINES_PER_SEGMENT; i++)
+        printf("%d", re.isInFastMem[i]);
+    printf("\n");
+}
+
+// hasFastMemSlot(): true unless the fast memory slot of this remap entry is reserved for the remap or region table
+bool customMemController::hasFastMemSlot(addrType remapIndex)
 {
-    addrType newAddress;
-    newAddress = remapIndex << NUM_CACHELINE_BITS;
-    return newAddress;
+    if (!config.useRemapCache || !config.remapTableInFastMem)
+        return true;
+    return translateAddress(remapIndex) < metadataBaseAddress;
 }
 
-// readTraceFile(): read the input trace file
-void readTraceFile(string file, timeType * endTime) {
-    ifstream trace_file;
+// isReservedAddress(): true if the address lies in the reserved remap or region table range of LPDRAM
+bool customMemController::isReservedAddress(addrType address)
+{
+    return config.useRemapCache && !config.remapTableInFastMem && address >= metadataBaseAddress;
+}
 
-    trace_file.open(file, ios::in);
-    if (trace_file.fail()) {
-        cout << "Failed to open Trace File: " << file << endl;
-        exit(1);
-    }
+// issueRLRequest(): deliver one request to RLDRAM at the current output time step
+void customMemController::issueRLRequest(addrType address, bool isWrite)
+{
+    RLCallback(address, isWrite, outputTimeStep);
+}
 
-    regex addr_exp("0[xX][0-9a-fA-F]+");
-    regex type_exp("READ|WRITE");
-    regex time_exp("\\d+$");
-    smatch m;
-
-    string currLine;
-    addrType addr;
-    bool isWrite;
-    timeType time;
-    bool error = false;
-    while (getline(trace_file, currLine)) {
-        // Get Address
-        if (regex_search(currLine, m, addr_exp)) {
-            for (auto x:m)
-                addr = stoul(x, 0, 16);
-        } else error = true;
-
-        // Get Type
-        if (regex_search(currLine, m, type_exp)) {
-            for (auto x:m)
-                isWrite = x == "WRITE";
-        } else error = true;
-
-        // Get Time
-        if (regex_search(currLine, m, time_exp)) {
-            for (auto x:m)
-                time = stoul(x);
-        } else error = true;
-
-        if (error) {
-            cout << "Error: Couldn't convert line." << endl;
-            exit(1);
-        }
+// issueLPRequest(): deliver one request to LPDRAM at the current output time step
+void customMemController::issueLPRequest(addrType address, bool isWrite)
+{
+    LPCallback(address, isWrite, outputTimeStep);
+}
 
-        memoryAccess * ptr = new memoryAccess(addr, isWrite, time); //TODO: Make this a smart pointer
-        memoryAccesses.push_back(ptr);
+// writeMetadataBlock(): write one remap or region table block to the reserved range, one cache line at a time; every
+// cache line the block spans is accessed, so a block that is not aligned to cache lines may cost one more
+void customMemController::writeMetadataBlock(addrType blockNum, bool isWrite)
+{
+    bool isRegionBlock = blockNum >= numRemapTableBlocks;
+    addrType baseAddress = config.remapTableInFastMem ? REMAP_TABLE_RL_BASE_ADDR : REMAP_TABLE_LP_BASE_ADDR;
+    if (isRegionBlock) {
+        baseAddress = metadataBaseAddress;
+        blockNum -= numRemapTableBlocks;
     }
 
-    *endTime = time;
+    // Offsets into the table. The region table holds whole blocks; the last remap table block is cut at the end of the
+    // table, which is also the end of the memory
+    unsigned long long firstByte = (unsigned long long)blockNum * remapTableCache.blockSize();
+    unsigned long long endByte = firstByte + remapTableCache.blockSize();
+    if (!isRegionBlock)
+        endByte = min(endByte, (unsigned long long)REMAP_TABLE_SIZE);
+
+    for (unsigned long long offset = firstByte & ~(CACHELINE_SIZE - 1ULL); offset < endByte; offset += CACHELINE_SIZE) {
+        addrType lineAddress = baseAddress + (addrType)offset;
+        if (config.remapTableInFastMem)
+            issueRLRequest(lineAddress, isWrite);
+        else
+            issueLPRequest(lineAddress, isWrite);
+    }
+}
 
-    trace_file.close();
+// lookupMetadataBlock(): look up a metadata block through the remap table cache; a miss stalls until the block is read
+// from memory. Return false without a lookup if the current access already looked the block up and it is still resident
+bool customMemController::lookupMetadataBlock(addrType blockNum, bool * isHit)
+{
+    if (find(lookedUpBlocks.begin(), lookedUpBlocks.end(), blockNum) != lookedUpBlocks.end()
+        && remapTableCache.isResident(blockNum))
+        return false;
+    lookedUpBlocks.push_back(blockNum);
+
+    long long evictedBlock;
+    *isHit = remapTableCache.access(blockNum, &evictedBlock);
+    if (*isHit)
+        return true;
+
+    if (evictedBlock != -1)
+        writeMetadataBlock(evictedBlock, WRITE);
+    writeMetadataBlock(blockNum, READ);
+    outputTimeStep++;
+    stats.numMetadataStalls++;
+    return true;
 }
 
-// writeToTraceFile(): write to output trace file
-void writeToTraceFile(ofstream &file, addrType address, bool isWrite) 
+// lookupRemapEntry(): look up a remap entry through the remap table cache
+void customMemController::lookupRemapEntry(addrType remapIndex)
 {
-    file << "0x";
-    file.width(8);
-    file.fill('0');
-    file << hex << uppercase << address << " ";
-    if (isWrite) {
-        file << "WRITE" << " ";
-    } else {
-        file << "READ" << " ";
-    }
-    file << dec << outputTimeStep << endl;
+    bool isHit;
+    if (lookupMetadataBlock(remapBlockNum(remapIndex), &isHit))
+        (isHit ? stats.numRemapCacheHits : stats.numRemapCacheMisses)++;
+}
+
+// remapBlockNum(): metadata block holding a remap entry
+addrType customMemController::remapBlockNum(addrType remapIndex)
+{
+    return remapIndex / config.remapCacheEntriesPerBlock;
 }
 
-// migrateCacheLine(): migrate cache line based
-void migrateCacheline(remapEntry * currentEntry, memoryAccess * currMemAccess, ofstream& RLTraceFileStream, ofstream& LPTraceFileStream) 
+// migrateCachelineReads(): issue the reads of a swap (FLAT_SWAP mode); return true if any read was issued
+bool customMemController::migrateCachelineReads(remapEntry * currentEntry, memoryAccess * currMemAccess) 
 {
     // Check if this entry has no cachelines in fast memory
     if (currentEntry->isEntryEmpty()) 
     {
         if (!currMemAccess->isWrite) 
         {
-            writeToTraceFile(LPTraceFileStream, currMemAccess->address, READ);
-            outputTimeStep++;
+            issueLPRequest(currMemAccess->address, READ);
+            stats.numMigrationRequests++;
         }
+        return !currMemAccess->isWrite;
+    }
 
-        writeToTraceFile(RLTraceFileStream, translateAddress(currMemAccess->remapIndex), WRITE);
-        outputTimeStep++;
-    } 
-    else 
+    // Swapping occurs here; number of steps for swap depends on READ or WRITE
+    if (!currMemAccess->isWrite) 
+    {
+        issueLPRequest(currMemAccess->address, READ);
+        stats.numMigrationRequests++;
+    }
+    issueRLRequest(translateAddress(currMemAccess->remapIndex), READ);
+    stats.numMigrationRequests++;
+    return true;
+}
+
+// migrateCachelineWrites(): issue the writes of a swap (FLAT_SWAP mode) and update the remap entry
+void customMemController::migrateCachelineWrites(remapEntry * currentEntry, memoryAccess * currMemAccess) 
+{
+    if (!currentEntry->isEntryEmpty()) 
     {
-        // Swapping occurs here; number of steps for swap depends on READ or WRITE
         int previousEntryIndex = currentEntry->findTrueFlag();
         addrType previousAddress = previousEntryIndex << (NUM_CACHELINE_BITS + NUM_CACHELINES_RLDRAM_BITS);
         previousAddress |= currMemAccess->remapIndex << NUM_CACHELINE_BITS;
+        issueLPRequest(previousAddress, WRITE);
+        stats.numMigrationRequests++;
+        proactiveLines.erase(previousAddress >> NUM_CACHELINE_BITS);
+    }
+    issueRLRequest(translateAddress(currMemAccess->remapIndex), WRITE);
+    stats.numMigrationRequests++;
 
-        if (currMemAccess->isWrite) 
-        {
-            writeToTraceFile(RLTraceFileStream, translateAddress(currMemAccess->remapIndex), READ);
-            outputTimeStep++;
-        } 
-        else 
-        {
-            writeToTraceFile(LPTraceFileStream, currMemAccess->address, READ);
-            writeToTraceFile(RLTraceFileStream, translateAddress(currMemAccess->remapIndex), READ);
-            outputTimeStep++;
-        }
-        writeToTraceFile(LPTraceFileStream, previousAddress, WRITE);
-        writeToTraceFile(RLTraceFileStream, translateAddress(currMemAccess->remapIndex), WRITE);
-        outputTimeStep++;
+    // Update remap table entry
+    currentEntry->resetFlags();
+    currentEntry->isInFastMem[currMemAccess->entryIndex] = true;
+    currentEntry->isReferenced = false;
+    currentEntry->resetCounter();
+}
+
+// fillCachelineReads(): issue the reads of a fill (INCLUSIVE_CACHE mode); return true if any read was issued
+bool customMemController::fillCachelineReads(remapEntry * currentEntry, memoryAccess * currMemAccess) 
+{
+    // A clean victim is simply dropped since slow memory still holds it; no swap read is needed
+    bool isWriteback = !currentEntry->isEntryEmpty() && currentEntry->isDirty;
+
+    if (isWriteback)
+        issueRLRequest(translateAddress(currMemAccess->remapIndex), READ);
+    if (!currMemAccess->isWrite)
+        issueLPRequest(currMemAccess->address, READ);
+    stats.numMigrationRequests += isWriteback + !currMemAccess->isWrite;
+    return isWriteback || !currMemAccess->isWrite;
+}
+
+// fillCachelineWrites(): issue the writes of a fill (INCLUSIVE_CACHE mode) and update the remap entry; the previous copy is written back only if dirty
+void customMemController::fillCachelineWrites(remapEntry * currentEntry, memoryAccess * currMemAccess) 
+{
+    int previousEntryIndex = currentEntry->findTrueFlag();
+    addrType previousAddress = previousEntryIndex << (NUM_CACHELINE_BITS + NUM_CACHELINES_RLDRAM_BITS);
+    previousAddress |= currMemAccess->remapIndex << NUM_CACHELINE_BITS;
+    if (previousEntryIndex != -1)
+        proactiveLines.erase(previousAddress >> NUM_CACHELINE_BITS);
+
+    if (previousEntryIndex != -1 && currentEntry->isDirty) 
+    {
+        issueLPRequest(previousAddress, WRITE);
+        stats.numWritebacks++;
+        stats.numMigrationRequests++;
     }
+    if (currMemAccess->isWrite && config.writePolicy == WRITE_THROUGH)
+        issueLPRequest(currMemAccess->address, WRITE);
+    issueRLRequest(translateAddress(currMemAccess->remapIndex), WRITE);
+    stats.numMigrationRequests++;
 
     // Update remap table entry
     currentEntry->resetFlags();
     currentEntry->isInFastMem[currMemAccess->entryIndex] = true;
+    currentEntry->isDirty = currMemAccess->isWrite && config.writePolicy == WRITE_BACK;
+    currentEntry->isReferenced = false;
     currentEntry->resetCounter();
+    stats.numFills++;
 }
 
-int main()
+// promoteCachelines(): move a batch of cache lines into fast memory (swap or fill depending on memMode).
+// All reads of the batch are issued in one time step and all writes in the next, so a batch costs as much time as a single line
+void customMemController::promoteCachelines(const vector<memoryAccess *>& batch) 
 {
-    string inputTraceFileName = "LU";
-    // string inputTraceFileName = "FFT";
-    // string inputTraceFileName = "RADIX";
-    // string inputTraceFileName = "testEntryIndexing";
-    // string inputTraceFileName = "testMigrations";
+    bool issuedReads = false;
+    for (auto ma : batch) {
+        proactiveLines.erase(ma->cacheLineAddr);
+        if (config.memMode == FLAT_SWAP)
+            issuedReads |= migrateCachelineReads(&remapTable[ma->remapIndex], ma);
+        else
+            issuedReads |= fillCachelineReads(&remapTable[ma->remapIndex], ma);
+    }
+    if (issuedReads)
+        outputTimeStep++;
 
-    string traceFile   = "traces/" + inputTraceFileName + ".trace";
-    string RLTraceFile = "traces/" + inputTraceFileName + "_RL" + ".trace";
-    string LPTraceFile = "traces/" + inputTraceFileName + "_LP" + ".trace";
+    for (auto ma : batch) {
+        if (config.memMode == FLAT_SWAP)
+            migrateCachelineWrites(&remapTable[ma->remapIndex], ma);
+        else
+            fillCachelineWrites(&remapTable[ma->remapIndex], ma);
+    }
+    outputTimeStep++;
+}
+
+// throttleProactiveMigration(): adapt the number of lines migrated ahead to the accuracy of the last window
+void customMemController::throttleProactiveMigration()
+{
+    if (windowProactiveMigrations < PROACTIVE_THROTTLE_WINDOW)
+        return;
+
+    double accuracy = (double)windowUsefulProactiveMigrations / windowProactiveMigrations;
+    if (accuracy < PROACTIVE_ACCURACY_LOW)
+        proactiveDegree = proactiveDegree / 2;
+    else if (accuracy > PROACTIVE_ACCURACY_HIGH)
+        proactiveDegree = min(PROACTIVE_DEGREE_MAX, proactiveDegree * 2);
 
-    ofstream RLTraceFileStream, LPTraceFileStream;
+    windowProactiveMigrations = 0;
+    windowUsefulProactiveMigrations = 0;
+}
 
-    RLTraceFileStream.open(RLTraceFile, ios::out);
-    if (RLTraceFileStream.fail()) {
-        cout << "Failed to open RL Trace File." << endl;
-        exit(1);
+// migrateAhead(): migrate the next lines of a confident stream into fast memory as one batch
+void customMemController::migrateAhead(memoryAccess * currMemAccess, int stride)
+{
+    // Throttled off; after a window of suppressed batches, re-enable at degree 1 until the next accuracy check
+    if (proactiveDegree == 0) {
+        if (++numSuppressedBatches < PROACTIVE_THROTTLE_WINDOW)
+            return;
+        numSuppressedBatches = 0;
+        proactiveDegree = 1;
     }
-    LPTraceFileStream.open(LPTraceFile, ios::out);
-    if (LPTraceFileStream.fail()) {
-        cout << "Failed to open LP Trace File." << endl;
-        exit(1);
+
+    vector<memoryAccess> targets;
+    targets.reserve(proactiveDegree);
+
+    for (int i = 1; i <= proactiveDegree; i++) {
+        long long cacheLineAddr = (long long)currMemAccess->cacheLineAddr + (long long)i * stride;
+        if (cacheLineAddr < 0 || cacheLineAddr >= (long long)(LPDRAM_SIZE >> NUM_CACHELINE_BITS))
+            break;
+
+        memoryAccess target((addrType)cacheLineAddr << NUM_CACHELINE_BITS, READ, outputTimeStep);
+        // Lines sharing a remap entry with the current access would evict it
+        if (target.remapIndex == currMemAccess->remapIndex || isReservedAddress(target.address))
+            break;
+        remapEntry * targetEntry = &remapTable[target.remapIndex];
+        if (!hasFastMemSlot(target.remapIndex) || targetEntry->isInFastMem[target.entryIndex])
+            continue;
+
+        // A line hit since the previous attempt (never a pending proactive line) is not evicted for a speculative one;
+        // it is protected again only if hit before the next attempt
+        if (targetEntry->isReferenced) {
+            targetEntry->isReferenced = false;
+            if (config.useRemapCache)
+            {
+                lookupRemapEntry(target.remapIndex);
+                remapTableCache.markDirty(remapBlockNum(target.remapIndex));
+            }
+            stats.numSkippedProactiveTargets++;
+            continue;
+        }
+        targets.push_back(target);
     }
+    if (targets.empty())
+        return;
 
-    numSwaps = 0;
-    numMoveToFast = 0;
-    numMoveToSlow = 0;
+    vector<memoryAccess *> batch;
+    for (auto &target : targets) {
+        if (config.useRemapCache)
+        {
+            lookupRemapEntry(target.remapIndex);
+            remapTableCache.markDirty(remapBlockNum(target.remapIndex));
+        }
+        batch.push_back(&target);
+    }
+    promoteCachelines(batch);
 
-    outputTimeStep = 0;
+    for (auto &target : targets)
+        proactiveLines.insert(target.cacheLineAddr);
 
-    // 2. Read the Trace file
-    cout << "Reading Input Trace File..." << endl;
-    timeType traceEndTime;
-    readTraceFile(traceFile, &traceEndTime);
-    cout << "Completed Reading Input Trace File. Trace End Cycle: " << traceEndTime << endl;
+    stats.numProactiveMigrations += targets.size();
+    windowProactiveMigrations += targets.size();
+    throttleProactiveMigration();
+}
 
-    // Start iteration through all time-steps until the traceEndTime
-    cout << "Started Memory Controller Simulation..." << endl;
-    cout << "---------------------------------------" << endl;
+// isRegionMode(): true if promotions are decided by region counters instead of remap entry counters
+bool customMemController::isRegionMode()
+{
+    return config.adaptiveGranularity || config.migrationUnit > CACHELINE_SIZE;
+}
 
-    memoryAccess * currMemAccess;
-    remapEntry * currentEntry;
-    int numMigrations = 0;
+// linesPerRegion(): number of cache lines sharing one region counter
+int customMemController::linesPerRegion()
+{
+    return config.adaptiveGranularity ? NUM_CACHELINES_PER_REGION : config.migrationUnit / CACHELINE_SIZE;
+}
 
-    // Iterate through all the lines read from the trace file
-    for(int inputTraceIdx = 0; inputTraceIdx < memoryAccesses.size(); ++inputTraceIdx)
-    {
-        currMemAccess = memoryAccesses[inputTraceIdx];
-        
-        inputTimeStep = currMemAccess->timeStamp;
+// regionNum(): index of the region holding the accessed cache line
+addrType customMemController::regionNum(memoryAccess * currMemAccess)
+{
+    return currMemAccess->cacheLineAddr / linesPerRegion();
+}
 
-        // Update output time step to be used in output trace file time stamp
-        outputTimeStep = max(outputTimeStep, inputTimeStep);
+// regionEntrySize(): bytes of one region table entry; only the adaptive mode reads, and so keeps, the touched lines
+int customMemController::regionEntrySize()
+{
+    return REGION_COUNTER_SIZE + (config.adaptiveGranularity ? REGION_TOUCHED_SIZE : 0);
+}
 
-        currentEntry = &remapTable[currMemAccess->remapIndex];
+// regionBlockNum(): metadata block holding the region table entry of the accessed region
+addrType customMemController::regionBlockNum(memoryAccess * currMemAccess)
+{
+    return numRemapTableBlocks + regionNum(currMemAccess) / regionsPerBlock;
+}
 
-        currentEntry->updateCounter(currMemAccess->entryIndex);
+// lookupRegion(): look up the accessed region's entry through the remap table cache
+void customMemController::lookupRegion(memoryAccess * currMemAccess)
+{
+    bool isHit;
+    if (lookupMetadataBlock(regionBlockNum(currMemAccess), &isHit))
+        (isHit ? stats.numRegionTableHits : stats.numRegionTableMisses)++;
+}
 
-        // printRemapTableEntry(currMemAccess->remapIndex);
-        if(currentEntry->isCounterAboveThreshold())
-        {
-            // cout << "---------- Migration Performed ----------" << endl;
-            migrateCacheline(currentEntry, currMemAccess, RLTraceFileStream, LPTraceFileStream);
-            printf("Address: 0x%x, RemapIndex: %d, EntryIndex: %d\n",
-                    currMemAccess->address, currMemAccess->remapIndex, currMemAccess->entryIndex);
-            numMigrations++;
-        }
-        else
+// updateRegion(): update the shared counter and the touched lines of the accessed region; return true if the counter
+// reached the promotion threshold
+bool customMemController::updateRegion(memoryAccess * currMemAccess, bool isInFastMem)
+{
+    regionEntry& region = regions[regionNum(currMemAccess)];
+    regionEntry previousRegion = region;
+
+    if (isInFastMem)
+        region.counter = max(0, region.counter - 1); // saturate downcount at 0
+    else
+        region.counter = min(127, region.counter + 1); // saturate upcount at 127, as remapEntry::counter
+    if (config.adaptiveGranularity)
+        region.touched |= 1ULL << (currMemAccess->cacheLineAddr % NUM_CACHELINES_PER_REGION);
+
+    // Region state lives in the region table, so it is read and written back through the remap cache like remap entries
+    if (config.useRemapCache) {
+        lookupRegion(currMemAccess);
+        if (region.counter != previousRegion.counter || region.touched != previousRegion.touched)
+            remapTableCache.markDirty(regionBlockNum(currMemAccess));
+    }
+
+    return region.counter >= PROMOTION_THRESHOLD;
+}
+
+// chooseMigrationUnit(): size of the unit to migrate for this access; in adaptive mode, the largest aligned unit around
+// the access in which enough lines were touched since the region was last promoted
+int customMemController::chooseMigrationUnit(memoryAccess * currMemAccess)
+{
+    if (!config.adaptiveGranularity)
+        return config.migrationUnit;
+
+    bitset<NUM_CACHELINES_PER_REGION> touched(regions[regionNum(currMemAccess)].touched);
+    int offset = currMemAccess->cacheLineAddr % NUM_CACHELINES_PER_REGION;
+
+    for (int unit = MIGRATION_REGION_SIZE; unit > CACHELINE_SIZE; unit /= 4) {
+        int linesPerUnit = unit / CACHELINE_SIZE;
+        int firstLine = offset & ~(linesPerUnit - 1);
+        int numTouched = 0;
+        for (int i = firstLine; i < firstLine + linesPerUnit; i++)
+            numTouched += touched[i];
+        if (numTouched >= SPATIAL_LOCALITY_THRESHOLD * linesPerUnit)
+            return unit;
+    }
+    return CACHELINE_SIZE;
+}
+
+// migrateUnit(): promote every line of the unit holding the accessed line as one burst; the accessed line keeps its
+// own operation, the others are moved as reads
+void customMemController::migrateUnit(memoryAccess * currMemAccess)
+{
+    int unit = chooseMigrationUnit(currMemAccess);
+    int linesPerUnit = unit / CACHELINE_SIZE;
+    addrType firstLine = currMemAccess->cacheLineAddr & ~(addrType)(linesPerUnit - 1);
+
+    vector<memoryAccess> lines;
+    lines.reserve(linesPerUnit);
+    for (int i = 0; i < linesPerUnit; i++) {
+        memoryAccess line((firstLine + i) << NUM_CACHELINE_BITS, READ, currMemAccess->timeStamp);
+        if (line.cacheLineAddr == currMemAccess->cacheLineAddr || !hasFastMemSlot(line.remapIndex)
+            || remapTable[line.remapIndex].isInFastMem[line.entryIndex])
+            continue;
+        lines.push_back(line);
+    }
+
+    // Lines of a unit have consecutive remap indices, so they mostly share remap cache blocks, each looked up once
+    vector<memoryAccess *> batch = {currMemAccess};
+    for (auto &line : lines) {
+        if (config.useRemapCache)
         {
-            if (currentEntry->isInFastMem[currMemAccess->entryIndex]) {
-                // Write to RL Tracefile with RemapIndex as the address
-                writeToTraceFile(RLTraceFileStream, translateAddress(currMemAccess->remapIndex), currMemAccess->isWrite);
-            } else {
-                // Write to LP Tracefile with original address
-                writeToTraceFile(LPTraceFileStream, currMemAccess->address, currMemAccess->isWrite);
-            }
-            outputTimeStep++;
+            lookupRemapEntry(line.remapIndex);
+            remapTableCache.markDirty(remapBlockNum(line.remapIndex));
         }
+        batch.push_back(&line);
     }
+    promoteCachelines(batch);
+
+    stats.numMigrationsPerUnit[int(log2(linesPerUnit)) / 2]++;
+    stats.numMigratedLines += batch.size();
+
+    // Reset the region state
+    regions.erase(regionNum(currMemAccess));
+    if (config.useRemapCache) {
+        lookupRegion(currMemAccess);
+        remapTableCache.markDirty(regionBlockNum(currMemAccess));
+    }
+}
+
+// computeNextUse(): for every access in the trace, the index of the next access to the same cache line;
+// accesses.size() if the line is never accessed again
+vector<size_t> computeNextUse(const vector<memoryAccess *>& accesses)
+{
+    vector<size_t> nextUse(accesses.size());
+    unordered_map<addrType, size_t> lastSeen;
 
-    RLTraceFileStream.close();
-    LPTraceFileStream.close();
+    for (size_t i = accesses.size(); i-- > 0;) {
+        auto it = lastSeen.find(accesses[i]->cacheLineAddr);
+        nextUse[i] = it == lastSeen.end() ? accesses.size() : it->second;
+        lastSeen[accesses[i]->cacheLineAddr] = i;
+    }
+    return nextUse;
+}
 
-    cout << "---------------------------------------" << endl;
-    cout << "Completed Memory Controller Simulation." << endl;
-    cout << "---------------------------------------" << endl;
-    cout << "Number of Migrations: " << numMigrations << endl;
-    cout << "Remap Table Size: " << countNumFastMemCacheLines() << endl;
+// runOracle(): offline Belady-style policy; within each remap entry, a line is swapped into fast memory when its next use
+// comes before the next use of the line currently there. Swaps are counted with the same requests as migrateCacheline*()
+void runOracle(const vector<memoryAccess *>& accesses, int * numHits, int * numMigrations, int * numRequests)
+{
+    struct resident {
+        int entryIndex;
+        size_t nextUse;
+    };
+
+    vector<size_t> nextUse = computeNextUse(accesses);
+    unordered_map<addrType, resident> fastMem;
+    const size_t never = accesses.size();
+
+    *numHits = 0;
+    *numMigrations = 0;
+    *numRequests = 0;
+
+    for (size_t i = 0; i < accesses.size(); i++) {
+        memoryAccess * ma = accesses[i];
+        auto it = fastMem.find(ma->remapIndex);
+
+        if (it != fastMem.end() && it->second.entryIndex == ma->entryIndex) {
+            it->second.nextUse = nextUse[i];
+            (*numHits)++;
+            continue;
+        }
+        if (nextUse[i] == never || (it != fastMem.end() && it->second.nextUse <= nextUse[i]))
+            continue;
+
+        // Same request count as a swap: the line is read unless written, fast memory is read and the victim written back if present
+        bool isEntryEmpty = it == fastMem.end();
+        *numRequests += !ma->isWrite + 1 + (isEntryEmpty ? 0 : 2);
+        fastMem[ma->remapIndex] = resident{ma->entryIndex, nextUse[i]};
+        (*numMigrations)++;
+    }
 }
+
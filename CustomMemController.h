@@ -3,6 +3,7 @@
 
 #include <array>
 #include <unordered_map>
+#include <unordered_set>
 #include <queue>
 #include <vector>
 #include <list>
@@ -12,11 +13,12 @@
 #include <memory>
 #include <string>
 #include <regex>
-
-using namespace std;
-
-#define WRITE true
-#define READ !WRITE
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <bitset>
+#include <stdexcept>
+#include <limits>
 
 #define MIGRATION_COST 1000 // Cycles
 
@@ -32,10 +34,58 @@ using namespace std;
 
 #define NUM_CACHELINES_PER_SEGMENT (LPDRAM_SIZE/RLDRAM_SIZE)
 
+// Remap table cache: on-chip SRAM that holds a subset of the remap table
+#define REMAP_ENTRY_SIZE 2 // Bytes; flags, dirty and referenced bits and counter of one remap entry
+#define REMAP_TABLE_SIZE (NUM_CACHELINES_RLDRAM*REMAP_ENTRY_SIZE) // 32MB
+// Default geometry; see controllerConfig
+#define REMAP_CACHE_SIZE (64*1024) // 64KB
+#define REMAP_CACHE_ASSOC 8
+#define REMAP_CACHE_ENTRIES_PER_BLOCK 32 // one 64B cache line of remap entries
+// Reserved address ranges holding the full remap table in each memory, used when the remap cache is modeled.
+// In region mode, the region table is reserved right below the remap table.
+// In RLDRAM, remap entries whose fast memory slot falls in the reserved range never hold a cache line.
+// In LPDRAM, accesses to the reserved range are rejected
+#define REMAP_TABLE_RL_BASE_ADDR ((addrType)(RLDRAM_SIZE - REMAP_TABLE_SIZE)) // top of RLDRAM
+#define REMAP_TABLE_LP_BASE_ADDR ((addrType)(LPDRAM_SIZE - REMAP_TABLE_SIZE)) // top of LPDRAM
+
+// Stream detector for proactive migration of the lines ahead of a sequential or strided stream
+#define STREAM_TABLE_SIZE 16
+#define STREAM_MAX_STRIDE 16 // Cache lines; accesses further away from every stream start a new one
+#define STREAM_CONFIDENCE_THRESHOLD 2 // Stride repetitions before lines ahead are migrated
+#define STREAM_CONFIDENCE_MAX 7
+#define PROACTIVE_DEGREE_MAX 8 // Lines migrated ahead of a stream per batch
+#define PROACTIVE_THROTTLE_WINDOW 64 // Proactive migrations between two accuracy checks
+#define PROACTIVE_ACCURACY_LOW 0.25 // Halve the degree (down to 0, i.e. off) below this fraction of useful proactive migrations
+#define PROACTIVE_ACCURACY_HIGH 0.75 // Double the degree above it
+
+// Multi-granularity migration; a unit is an aligned block of consecutive cache lines, which share one entryIndex
+#define MIGRATION_REGION_SIZE 4096 // Largest migration unit; the adaptive mode tracks locality per region of this size
+#define NUM_CACHELINES_PER_REGION (MIGRATION_REGION_SIZE/CACHELINE_SIZE)
+#define NUM_MIGRATION_UNITS 4 // 64B, 256B, 1KB, 4KB
+#define SPATIAL_LOCALITY_THRESHOLD 0.5 // Fraction of a unit's lines touched for the adaptive mode to migrate the whole unit
+// Region table: state of every LPDRAM region, stored and cached like the remap table; entries never straddle a block
+#define REGION_COUNTER_SIZE 1 // Bytes; shared counter of one region
+#define REGION_TOUCHED_SIZE (NUM_CACHELINES_PER_REGION/8) // Bytes; touched lines of one region (adaptive mode only)
+
+// Submission rings of the threaded interface
+#define MAX_PRODUCERS 16
+#define SUBMISSION_RING_SIZE 4096 // Accesses per producer ring; must be a power of 2
+
 typedef unsigned int addrType;
 typedef unsigned long long timeType;
 
-void writeToTraceFile(ofstream &file, addrType address, bool isWrite);
+// memoryMode: organization of RLDRAM with respect to LPDRAM
+enum memoryMode {
+    FLAT_SWAP,          // exclusive: a cache line lives in either RLDRAM or LPDRAM; promotion swaps lines
+    INCLUSIVE_CACHE     // inclusive: RLDRAM holds a copy of an LPDRAM cache line; promotion fills a copy
+};
+
+// cacheWritePolicy: how writes to a cached line reach LPDRAM in INCLUSIVE_CACHE mode
+enum cacheWritePolicy {
+    WRITE_BACK,         // write only to RLDRAM and mark the line dirty; LPDRAM is updated on eviction
+    WRITE_THROUGH       // write to both RLDRAM and LPDRAM; evictions never need a write back
+};
+
 addrType translateAddress(int remapIndex);
 
 // class remapEntry: Store information about one entry in the remap table
@@ -44,9 +94,14 @@ class remapEntry
     public:
     
     // isInFastMem: flags to indicate which segment/cache line is in fast memory
-    array<bool, NUM_CACHELINES_PER_SEGMENT> isInFastMem;
+    std::array<bool, NUM_CACHELINES_PER_SEGMENT> isInFastMem;
     // counter: shared counter for all segments in this entry
     int8_t counter;
+    // isDirty: set if the copy in fast memory is newer than the one in slow memory (INCLUSIVE_CACHE mode only)
+    bool isDirty;
+    // isReferenced: set when the line in fast memory is hit; a proactive migration skips the entry and clears it instead
+    // of evicting the line, so only lines not hit since the previous attempt are replaced (proactive migration only)
+    bool isReferenced;
 
     // remapEntry(): initialize flags and counter to 0
     remapEntry();
@@ -70,6 +125,83 @@ class remapEntry
     bool isEntryEmpty();
 };
 
+// class remapCache: set-associative, LRU, write-back cache of metadata blocks (remap table, then region table); models
+// tags only
+class remapCache
+{
+    public:
+
+    // numHits, numMisses, numWritebacks: statistics of this cache
+    unsigned long long numHits;
+    unsigned long long numMisses;
+    unsigned long long numWritebacks;
+
+    // remapCache(): size in bytes; each block holds entriesPerBlock consecutive remap entries. Throws invalid_argument
+    // if the geometry leaves no set
+    remapCache(int cacheSize, int associativity, int entriesPerBlock);
+
+    // access(): look up a block and allocate it on a miss; return true on a hit.
+    // evictedBlock is set to the block number of a dirty victim that must be written back, or -1
+    bool access(addrType blockNum, long long * evictedBlock);
+
+    // isResident(): return true if the block is in the cache; does not count as an access
+    bool isResident(addrType blockNum);
+
+    // markDirty(): mark a (resident) block as modified
+    void markDirty(addrType blockNum);
+
+    // blockSize(): number of bytes of metadata in one block
+    int blockSize();
+
+    private:
+
+    struct block {
+        bool valid;
+        bool dirty;
+        addrType blockNum;
+        unsigned long long lastUse;
+    };
+
+    const int associativity;
+    const int entriesPerBlock;
+    const int numSets;
+    // sets: numSets * associativity blocks, one set after the other
+    std::vector<block> sets;
+    // useCount: incremented on every access; used as the LRU time stamp
+    unsigned long long useCount;
+
+    // findBlock(): return the resident block holding blockNum or nullptr
+    block * findBlock(addrType blockNum);
+};
+
+// class streamTable: detect sequential and strided streams of cache line addresses
+class streamTable
+{
+    public:
+
+    streamTable();
+
+    // update(): train the table with a cache line address; return the stride of its stream if the stream is
+    // confident and was advanced by this access, 0 otherwise
+    int update(addrType cacheLineAddr);
+
+    private:
+
+    struct stream {
+        bool valid;
+        // frontier: furthest cache line address reached by the stream
+        addrType frontier;
+        // stride: distance in cache lines between two consecutive advances of the frontier
+        int stride;
+        int confidence;
+        unsigned long long lastUse;
+    };
+
+    std::array<stream, STREAM_TABLE_SIZE> streams;
+    // useCount: incremented on every update; used as the LRU time stamp
+    unsigned long long useCount;
+};
+
 // class memoryAccess: extract and store required information from the address read from the input trace file
 class memoryAccess 
 {
@@ -91,7 +223,256 @@ class memoryAccess
     memoryAccess(addrType address, bool isWrite, timeType timeStamp);
 
     // overload the outstream operator to conviniently print out relevant information from objects of this class
-    friend ostream& operator<<(ostream& os, memoryAccess const& ma);
+    friend std::ostream& operator<<(std::ostream& os, memoryAccess const& ma);
+};
+
+// accessRequest: one memory access as submitted by a producer thread
+struct accessRequest
+{
+    addrType address;
+    bool isWrite;
+    timeType timeStamp;
 };
 
+// class spscRing: lock-free ring buffer with exactly one producer thread and one consumer thread
+template <typename T, size_t SIZE>
+class spscRing
+{
+    static_assert((SIZE & (SIZE - 1)) == 0, "spscRing size must be a power of 2");
+
+    public:
+
+    // push(): producer side; return false if the ring is full
+    bool push(const T& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == SIZE)
+            return false;
+        slots[t & (SIZE - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // front(): consumer side; return the oldest item or nullptr if the ring is empty
+    T * front()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return nullptr;
+        return &slots[h & (SIZE - 1)];
+    }
+
+    // pop(): consumer side; drop the item returned by front()
+    void pop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    private:
+
+    std::array<T, SIZE> slots;
+    // head and tail are on separate cache lines so producer and consumer do not share one
+    alignas(CACHELINE_SIZE) std::atomic<size_t> head{0};
+    alignas(CACHELINE_SIZE) std::atomic<size_t> tail{0};
+};
+
+// requestCallback: receives every request the controller issues to one memory, with its output time step
+typedef std::function<void(addrType address, bool isWrite, timeType timeStep)> requestCallback;
+
+// struct controllerConfig: policies of one controller instance
+struct controllerConfig
+{
+    // memMode: organization of RLDRAM with respect to LPDRAM
+    memoryMode memMode = FLAT_SWAP;
+    // writePolicy: write policy of RLDRAM when memMode is INCLUSIVE_CACHE
+    cacheWritePolicy writePolicy = WRITE_BACK;
+    // useRemapCache: model the on-chip remap table cache and emit its metadata traffic
+    bool useRemapCache = true;
+    // remapTableInFastMem: the full remap table is stored in RLDRAM if true, LPDRAM otherwise
+    bool remapTableInFastMem = true;
+    // remapCacheSize, remapCacheAssociativity, remapCacheEntriesPerBlock: geometry of the remap table cache
+    int remapCacheSize = REMAP_CACHE_SIZE;
+    int remapCacheAssociativity = REMAP_CACHE_ASSOC;
+    int remapCacheEntriesPerBlock = REMAP_CACHE_ENTRIES_PER_BLOCK;
+    // useProactiveMigration: migrate the lines ahead of detected streams before they reach the promotion threshold
+    bool useProactiveMigration = true;
+    // migrationUnit: bytes moved per promotion decision; CACHELINE_SIZE, 256, 1024 or MIGRATION_REGION_SIZE.
+    // The controller throws invalid_argument for any other value
+    int migrationUnit = CACHELINE_SIZE;
+    // adaptiveGranularity: pick the unit per region from its observed spatial locality (overrides migrationUnit)
+    bool adaptiveGranularity = false;
+};
+
+// struct controllerStats: statistics of one controller instance
+struct controllerStats
+{
+    unsigned long long numAccesses = 0;
+    int numMigrations = 0;
+    int numFastMemHits = 0;
+    int numFills = 0;
+    int numWritebacks = 0;
+    // numMigrationRequests: output requests issued to perform promotions
+    int numMigrationRequests = 0;
+    int numProactiveMigrations = 0;
+    int numUsefulProactiveMigrations = 0;
+    // numSkippedProactiveTargets: proactive migrations not done because the target's entry held a recently hit line
+    int numSkippedProactiveTargets = 0;
+    // numMigrationsPerUnit: promotion decisions per migration unit size (64B, 256B, 1KB, 4KB)
+    std::array<int, NUM_MIGRATION_UNITS> numMigrationsPerUnit = {};
+    // numMigratedLines: cache lines moved by promotion decisions, excluding proactive migrations
+    int numMigratedLines = 0;
+    // numRemapCacheHits, numRemapCacheMisses: remap cache lookups of remap table blocks
+    unsigned long long numRemapCacheHits = 0;
+    unsigned long long numRemapCacheMisses = 0;
+    // numRegionTableHits, numRegionTableMisses: remap cache lookups of region table blocks (region mode only)
+    unsigned long long numRegionTableHits = 0;
+    unsigned long long numRegionTableMisses = 0;
+    // numRemapCacheWritebacks: dirty blocks of either table written back
+    unsigned long long numRemapCacheWritebacks = 0;
+    // numMetadataStalls: output time steps spent waiting for remap table and region table blocks
+    timeType numMetadataStalls = 0;
+};
+
+// class customMemController: one hybrid RLDRAM/LPDRAM memory controller. Accesses are either passed to access() by a
+// single caller, or submitted by up to MAX_PRODUCERS threads and processed by the controller thread (start()/stop()).
+// The two interfaces must not be mixed while the controller thread runs. Requests are delivered through the callbacks
+// on the thread that processes the access.
+class customMemController
+{
+    public:
+
+    customMemController(const controllerConfig& config, requestCallback RLCallback, requestCallback LPCallback);
+    ~customMemController();
+
+    // access(): process one access; accesses must be passed in time stamp order.
+    // Throws out_of_range if the address lies in the reserved remap table range of LPDRAM
+    void access(addrType address, bool isWrite, timeType timeStamp);
+
+    // registerProducer(): allocate a submission ring for one producer thread before start(); return its id, or -1 if
+    // MAX_PRODUCERS rings are already in use. Throws logic_error while the controller thread runs
+    int registerProducer();
+
+    // submit(): producer side; queue one access on the producer's ring; return false if the ring is full.
+    // Each producer must submit in time stamp order. Throws out_of_range like access(), or for an unregistered producerId
+    bool submit(int producerId, addrType address, bool isWrite, timeType timeStamp);
+
+    // advanceTime(): producer side; promise that this producer will not submit any access older than timeStamp, so the
+    // controller can process older accesses of other producers while this producer's ring is empty. A producer that
+    // waits on other producers (e.g. at a barrier) must advance its time first, or the controller waits for it.
+    // Throws out_of_range for an unregistered producerId
+    void advanceTime(int producerId, timeType timeStamp);
+
+    // closeProducer(): producer side; signal that this producer will not submit any more accesses.
+    // Throws out_of_range for an unregistered producerId
+    void closeProducer(int producerId);
+
+    // start(): launch the controller thread, which drains all rings in time stamp order. Throws logic_error if it
+    // already runs
+    void start();
+
+    // stop(): wait until every producer is closed and its ring is drained, then join the controller thread.
+    // Destroying a running controller instead stops its thread right away and drops the accesses still queued
+    void stop();
+
+    // getStats(): statistics so far; only valid while the controller thread is not running
+    controllerStats getStats();
+
+    // countNumFastMemCacheLines(): number of remap entries with a cache line in fast memory
+    int countNumFastMemCacheLines();
+
+    // printRemapTableEntry(): print one entry of the remap table; use only for debugging
+    void printRemapTableEntry(int remapIndex);
+
+    private:
+
+    struct producerRing {
+        spscRing<accessRequest, SUBMISSION_RING_SIZE> ring;
+        std::atomic<bool> closed{false};
+        // watermark: no access older than this will be submitted
+        std::atomic<timeType> watermark{0};
+    };
+
+    const controllerConfig config;
+    requestCallback RLCallback;
+    requestCallback LPCallback;
+
+    // outputTimeStep: timestep of the most recently issued output request
+    timeType outputTimeStep;
+    controllerStats stats;
+
+    // remapTable: array to store the remap entries
+    std::vector<remapEntry> remapTable;
+    remapCache remapTableCache;
+    // lookedUpBlocks: metadata blocks looked up by the current access; each is looked up once per access
+    std::vector<addrType> lookedUpBlocks;
+    // numRemapTableBlocks: the region table's blocks are numbered after the remap table's
+    addrType numRemapTableBlocks;
+    // regionsPerBlock: region table entries per metadata block (region mode only)
+    int regionsPerBlock;
+    // metadataBaseAddress: start of the reserved range; the region table, if any, else the remap table
+    addrType metadataBaseAddress;
+    streamTable streamDetector;
+
+    // Proactive migration state
+    int proactiveDegree;
+    int windowProactiveMigrations;
+    int windowUsefulProactiveMigrations;
+    int numSuppressedBatches;
+    // proactiveLines: cache lines migrated proactively that have not been accessed in fast memory yet
+    std::unordered_set<addrType> proactiveLines;
+
+    // Region-level state used when migrating units larger than a cache line
+    struct regionEntry {
+        // counter: shared counter of all lines in the region; same policy as remapEntry::counter
+        int counter;
+        // touched: lines of the region accessed since its last promotion (adaptive mode only)
+        uint64_t touched;
+    };
+    // regions: indexed by cache line address / lines per region; a region is one migration unit, or
+    // MIGRATION_REGION_SIZE bytes in adaptive mode. Holds only regions touched since their last promotion; the state is
+    // charged as metadata of the region's entry in the region table
+    std::unordered_map<addrType, regionEntry> regions;
+
+    // Threaded interface
+    std::array<std::unique_ptr<producerRing>, MAX_PRODUCERS> producers;
+    int numProducers;
+    std::thread controllerThread;
+    // isAborting: set by the destructor to stop the controller thread without waiting for the producers
+    std::atomic<bool> isAborting{false};
+
+    producerRing& getProducer(int producerId);
+    void drainRings();
+    bool hasFastMemSlot(addrType remapIndex);
+    bool isReservedAddress(addrType address);
+    void issueRLRequest(addrType address, bool isWrite);
+    void issueLPRequest(addrType address, bool isWrite);
+    void writeMetadataBlock(addrType blockNum, bool isWrite);
+    bool lookupMetadataBlock(addrType blockNum, bool * isHit);
+    void lookupRemapEntry(addrType remapIndex);
+    addrType remapBlockNum(addrType remapIndex);
+    bool migrateCachelineReads(remapEntry * currentEntry, memoryAccess * currMemAccess);
+    void migrateCachelineWrites(remapEntry * currentEntry, memoryAccess * currMemAccess);
+    bool fillCachelineReads(remapEntry * currentEntry, memoryAccess * currMemAccess);
+    void fillCachelineWrites(remapEntry * currentEntry, memoryAccess * currMemAccess);
+    void promoteCachelines(const std::vector<memoryAccess *>& batch);
+    void throttleProactiveMigration();
+    void migrateAhead(memoryAccess * currMemAccess, int stride);
+    bool isRegionMode();
+    int linesPerRegion();
+    addrType regionNum(memoryAccess * currMemAccess);
+    int regionEntrySize();
+    addrType regionBlockNum(memoryAccess * currMemAccess);
+    void lookupRegion(memoryAccess * currMemAccess);
+    bool updateRegion(memoryAccess * currMemAccess, bool isInFastMem);
+    int chooseMigrationUnit(memoryAccess * currMemAccess);
+    void migrateUnit(memoryAccess * currMemAccess);
+};
+
+// computeNextUse(): for every access in the trace, the index of the next access to the same cache line;
+// accesses.size() if the line is never accessed again
+std::vector<size_t> computeNextUse(const std::vector<memoryAccess *>& accesses);
+
+// runOracle(): offline Belady-style policy over a whole trace
+void runOracle(const std::vector<memoryAccess *>& accesses, int * numHits, int * numMigrations, int * numRequests);
+
 #endif // CUSTOMMEMCONTROLLER_H
@@ -0,0 +1,286 @@
+#include "CustomMemController.h"
+#include <algorithm>
+
+using namespace std;
+
+// Trace file driver: runs one controller instance over an input trace file and writes its RL and LP output traces
+
+// memoryAccesses: array of all the input trace file memory accesses
+vector<memoryAccess *> memoryAccesses;
+
+// readTraceFile(): read the input trace file
+void readTraceFile(string file, timeType * endTime) {
+    ifstream trace_file;
+
+    trace_file.open(file, ios::in);
+    if (trace_file.fail()) {
+        cout << "Failed to open Trace File: " << file << endl;
+        exit(1);
+    }
+
+    regex addr_exp("0[xX][0-9a-fA-F]+");
+    regex type_exp("READ|WRITE");
+    regex time_exp("\\d+$");
+    smatch m;
+
+    string currLine;
+    addrType addr;
+    bool isWrite;
+    timeType time;
+    bool error = false;
+    while (getline(trace_file, currLine)) {
+        // Get Address
+        if (regex_search(currLine, m, addr_exp)) {
+            for (auto x:m)
+                addr = stoul(x, 0, 16);
+        } else error = true;
+
+        // Get Type
+        if (regex_search(currLine, m, type_exp)) {
+            for (auto x:m)
+                isWrite = x == "WRITE";
+        } else error = true;
+
+        // Get Time
+        if (regex_search(currLine, m, time_exp)) {
+            for (auto x:m)
+                time = stoul(x);
+        } else error = true;
+
+        if (error) {
+            cout << "Error: Couldn't convert line." << endl;
+            exit(1);
+        }
+
+        memoryAccess * ptr = new memoryAccess(addr, isWrite, time); //TODO: Make this a smart pointer
+        memoryAccesses.push_back(ptr);
+    }
+
+    *endTime = time;
+
+    trace_file.close();
+}
+
+// writeToTraceFile(): write to output trace file
+void writeToTraceFile(ofstream &file, addrType address, bool isWrite, timeType timeStep) 
+{
+    file << "0x";
+    file.width(8);
+    file.fill('0');
+    file << hex << uppercase << address << " ";
+    if (isWrite) {
+        file << "WRITE" << " ";
+    } else {
+        file << "READ" << " ";
+    }
+    file << dec << timeStep << endl;
+}
+
+
+// checkSubmissionRings(): feed the trace through numProducers producer threads, round robin, and check that the
+// controller issues the same requests as when the trace is passed to access() in the order the rings are drained
+bool checkSubmissionRings(const controllerConfig& config, int numProducers)
+{
+    vector<accessRequest> expectedRL, expectedLP, actualRL, actualLP;
+    auto record = [](vector<accessRequest>& requests) {
+        return [&requests](addrType address, bool isWrite, timeType timeStep) {
+            requests.push_back(accessRequest{address, isWrite, timeStep});
+        };
+    };
+
+    // Equal time stamps are drained in producer order
+    vector<size_t> order(memoryAccesses.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (memoryAccesses[a]->timeStamp != memoryAccesses[b]->timeStamp)
+            return memoryAccesses[a]->timeStamp < memoryAccesses[b]->timeStamp;
+        return a % numProducers < b % numProducers;
+    });
+    {
+        customMemController controller(config, record(expectedRL), record(expectedLP));
+        for (auto i : order)
+            controller.access(memoryAccesses[i]->address, memoryAccesses[i]->isWrite, memoryAccesses[i]->timeStamp);
+    }
+
+    customMemController controller(config, record(actualRL), record(actualLP));
+    vector<int> producerIds;
+    for (int p = 0; p < numProducers; p++) {
+        int producerId = controller.registerProducer();
+        if (producerId == -1) {
+            cout << "Failed to register producer " << p << " of " << numProducers << "." << endl;
+            return false;
+        }
+        producerIds.push_back(producerId);
+    }
+    controller.start();
+
+    vector<thread> producers;
+    for (int p = 0; p < numProducers; p++) {
+        producers.emplace_back([&, p]() {
+            for (size_t i = p; i < memoryAccesses.size(); i += numProducers) {
+                memoryAccess * ma = memoryAccesses[i];
+                while (!controller.submit(producerIds[p], ma->address, ma->isWrite, ma->timeStamp))
+                    this_thread::yield();
+                controller.advanceTime(producerIds[p], ma->timeStamp);
+            }
+            controller.closeProducer(producerIds[p]);
+        });
+    }
+    for (auto &producer : producers)
+        producer.join();
+    controller.stop();
+
+    auto isEqual = [](const vector<accessRequest>& a, const vector<accessRequest>& b) {
+        return equal(a.begin(), a.end(), b.begin(), b.end(), [](const accessRequest& x, const accessRequest& y) {
+            return x.address == y.address && x.isWrite == y.isWrite && x.timeStamp == y.timeStamp;
+        });
+    };
+    return isEqual(expectedRL, actualRL) && isEqual(expectedLP, actualLP);
+}
+
+int main()
+try
+{
+    string inputTraceFileName = "LU";
+    // string inputTraceFileName = "FFT";
+    // string inputTraceFileName = "RADIX";
+    // string inputTraceFileName = "testEntryIndexing";
+    // string inputTraceFileName = "testMigrations";
+
+    controllerConfig config;
+    config.memMode = FLAT_SWAP;
+    // config.memMode = INCLUSIVE_CACHE;
+    config.writePolicy = WRITE_BACK;
+    // config.writePolicy = WRITE_THROUGH;
+    config.useRemapCache = true;
+    config.remapTableInFastMem = true;
+    config.remapCacheSize = REMAP_CACHE_SIZE;
+    config.remapCacheAssociativity = REMAP_CACHE_ASSOC;
+    config.remapCacheEntriesPerBlock = REMAP_CACHE_ENTRIES_PER_BLOCK;
+    config.useProactiveMigration = true;
+    config.migrationUnit = CACHELINE_SIZE;
+    // config.migrationUnit = 256;
+    // config.migrationUnit = 1024;
+    // config.migrationUnit = 4096;
+    config.adaptiveGranularity = false;
+    // config.adaptiveGranularity = true;
+    bool runOracleStudy = true;
+    bool runRingCheck = true;
+
+    string traceFile   = "traces/" + inputTraceFileName + ".trace";
+    string RLTraceFile = "traces/" + inputTraceFileName + "_RL" + ".trace";
+    string LPTraceFile = "traces/" + inputTraceFileName + "_LP" + ".trace";
+
+    ofstream RLTraceFileStream, LPTraceFileStream;
+
+    RLTraceFileStream.open(RLTraceFile, ios::out);
+    if (RLTraceFileStream.fail()) {
+        cout << "Failed to open RL Trace File." << endl;
+        exit(1);
+    }
+    LPTraceFileStream.open(LPTraceFile, ios::out);
+    if (LPTraceFileStream.fail()) {
+        cout << "Failed to open LP Trace File." << endl;
+        exit(1);
+    }
+
+    // 2. Read the Trace file
+    cout << "Reading Input Trace File..." << endl;
+    timeType traceEndTime;
+    readTraceFile(traceFile, &traceEndTime);
+    cout << "Completed Reading Input Trace File. Trace End Cycle: " << traceEndTime << endl;
+
+    // Start iteration through all time-steps until the traceEndTime
+    cout << "Started Memory Controller Simulation..." << endl;
+    cout << "---------------------------------------" << endl;
+
+    customMemController controller(config,
+        [&](addrType address, bool isWrite, timeType timeStep) { writeToTraceFile(RLTraceFileStream, address, isWrite, timeStep); },
+        [&](addrType address, bool isWrite, timeType timeStep) { writeToTraceFile(LPTraceFileStream, address, isWrite, timeStep); });
+
+    // Iterate through all the lines read from the trace file
+    for (auto currMemAccess : memoryAccesses)
+        controller.access(currMemAccess->address, currMemAccess->isWrite, currMemAccess->timeStamp);
+
+    RLTraceFileStream.close();
+    LPTraceFileStream.close();
+
+    controllerStats stats = controller.getStats();
+
+    cout << "---------------------------------------" << endl;
+    cout << "Completed Memory Controller Simulation." << endl;
+    cout << "---------------------------------------" << endl;
+    cout << "Number of Migrations: " << stats.numMigrations << endl;
+    cout << "Migrated Lines: " << stats.numMigratedLines << " (64B: " << stats.numMigrationsPerUnit[0]
+        << ", 256B: " << stats.numMigrationsPerUnit[1] << ", 1KB: " << stats.numMigrationsPerUnit[2]
+        << ", 4KB: " << stats.numMigrationsPerUnit[3] << ")" << endl;
+    cout << "Remap Table Size: " << controller.countNumFastMemCacheLines() << endl;
+    cout << "Fast Memory Hits: " << stats.numFastMemHits << " / " << stats.numAccesses << endl;
+    if (config.memMode == INCLUSIVE_CACHE) {
+        cout << "Number of Fills: " << stats.numFills << endl;
+        cout << "Number of Write Backs: " << stats.numWritebacks << endl;
+    }
+    if (config.useProactiveMigration) {
+        cout << "Proactive Migrations: " << stats.numProactiveMigrations << " (" << stats.numUsefulProactiveMigrations << " useful, "
+            << stats.numSkippedProactiveTargets << " skipped to keep recently hit lines)" << endl;
+    }
+    if (config.useRemapCache) {
+        cout << "Remap Cache Hit Rate: " << (double)stats.numRemapCacheHits / (stats.numRemapCacheHits + stats.numRemapCacheMisses)
+            << " (" << stats.numRemapCacheHits << " hits, " << stats.numRemapCacheMisses << " misses)" << endl;
+        if (config.adaptiveGranularity || config.migrationUnit > CACHELINE_SIZE)
+            cout << "Region Table Hit Rate: " << (double)stats.numRegionTableHits / (stats.numRegionTableHits + stats.numRegionTableMisses)
+                << " (" << stats.numRegionTableHits << " hits, " << stats.numRegionTableMisses << " misses)" << endl;
+        cout << "Remap Cache Metadata Write Backs: " << stats.numRemapCacheWritebacks << endl;
+        cout << "Remap Cache Added Latency: " << stats.numMetadataStalls << " cycles ("
+            << (double)stats.numMetadataStalls / stats.numAccesses << " per access)" << endl;
+    }
+
+    if (runOracleStudy) {
+        int oracleHits, oracleMigrations, oracleRequests;
+        runOracle(memoryAccesses, &oracleHits, &oracleMigrations, &oracleRequests);
+
+        // The oracle is a demand-only, per-line FLAT_SWAP policy, so it bounds the shared-counter policy alone; that
+        // policy is run separately when the configured one adds cache mode, proactive or multi-line migration
+        controllerConfig demandConfig;
+        demandConfig.memMode = FLAT_SWAP;
+        demandConfig.useRemapCache = false;
+        demandConfig.useProactiveMigration = false;
+        demandConfig.migrationUnit = CACHELINE_SIZE;
+        demandConfig.adaptiveGranularity = false;
+
+        cout << "---------------------------------------" << endl;
+        if (config.memMode != FLAT_SWAP || config.useProactiveMigration || config.migrationUnit != CACHELINE_SIZE
+            || config.adaptiveGranularity)
+            cout << "Note: oracle is compared against a demand-only 64B FLAT_SWAP run, not the configured policy" << endl;
+
+        customMemController demandController(demandConfig,
+            [](addrType, bool, timeType) {},
+            [](addrType, bool, timeType) {});
+        for (auto currMemAccess : memoryAccesses)
+            demandController.access(currMemAccess->address, currMemAccess->isWrite, currMemAccess->timeStamp);
+        controllerStats demandStats = demandController.getStats();
+
+        // Migrations are counted in cache lines on both sides
+        cout << "Policy\tHit Rate\tMigrations\tMigration Requests" << endl;
+        cout << "Online\t" << (double)demandStats.numFastMemHits / demandStats.numAccesses << "\t"
+            << demandStats.numMigratedLines << "\t" << demandStats.numMigrationRequests << endl;
+        cout << "Oracle\t" << (double)oracleHits / memoryAccesses.size() << "\t"
+            << oracleMigrations << "\t" << oracleRequests << endl;
+    }
+
+    if (runRingCheck) {
+        const int numProducers = 4;
+        bool isMatch = checkSubmissionRings(config, numProducers);
+        cout << "---------------------------------------" << endl;
+        cout << "Submission Rings (" << numProducers << " producers) match access(): " << (isMatch ? "yes" : "NO") << endl;
+        if (!isMatch)
+            exit(1);
+    }
+}
+catch (const exception& e)
+{
+    // The controller rejects invalid configurations and accesses with an exception
+    cout << "Error: " << e.what() << endl;
+    exit(1);
+}